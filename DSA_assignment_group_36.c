@@ -1,10 +1,24 @@
+#include <limits.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define MAX_ENTRIES 4
 #define MIN_ENTRIES 2
+#define UPDATE_SLACK 0  // default padding around a leaf MBR within which a moved entry stays put
+#define CHECK_POINTS 2000  // random points inserted by `./exec check`
+#define CHECK_MOVES 20000  // updates applied to them afterwards
+#define CHECK_SHARDED_POINTS 20000  // points inserted into the sharded index
+#define CHECK_SEARCH_EVERY 500      // sharded inserts between two searches compared against brute force
+
+#define NUM_SHARDS 4        // independent trees of the sharded index, each with its own worker thread
+#define REBALANCE_PERCENT 150  // a shard is skewed once it holds this percent of its fair share
+#define SHARD_QUEUE_DEPTH 1024  // jobs a shard can have queued before submitting blocks
+#define HILBERT_ORDER 32            // hilbert curve over the whole int plane, one level per bit of a coordinate
+#define HILBERT_LAST_KEY ULLONG_MAX  // 4^32 - 1, so the last shard's range ends inclusively here
 
 /* -----------------------------------------------STRUCTURE-----------------------------------------------------------
  */
@@ -14,6 +28,12 @@ typedef struct point Point;
 typedef struct rectangle Rect;
 typedef struct nodeEle NodeEle;
 typedef struct splitResult SplitResult;
+typedef struct resultList ResultList;
+typedef struct keyedRect KeyedRect;
+typedef enum jobType JobType;
+typedef struct shardJob ShardJob;
+typedef struct shard Shard;
+typedef struct shardedIndex ShardedIndex;
 
 // Assuming the coordinates to be integers
 
@@ -52,6 +72,7 @@ struct node
 struct rtree
 {
     Node *root;
+    int slack;  // padding allowed around a leaf MBR before an updated entry is reinserted
 };
 
 // Temporary struct used to help with node splitting to propagate data up the tree
@@ -63,12 +84,76 @@ struct splitResult
     Node *leaf2;
 };
 
+// Growable array of leaf rectangles collected by a search
+struct resultList
+{
+    Rect *rects;
+    int count;
+    int capacity;
+};
+
+// Rectangle along with its hilbert key, used to sort rectangles while rebalancing shards
+struct keyedRect
+{
+    unsigned long long key;
+    Rect rect;
+};
+
+enum jobType
+{
+    JOB_INSERT,
+    JOB_SEARCH,
+    JOB_SYNC,  // no-op, done once every job queued before it is done
+    JOB_STOP
+};
+
+// Work queued for the worker thread of a shard
+struct shardJob
+{
+    JobType type;
+    Rect rect;           // rectangle to be inserted or searched
+    ResultList results;  // leaf rectangles found by a search
+    bool done;           // set by the worker for search and sync jobs
+    ShardJob *next;
+};
+
+// One tree of the sharded index owning a contiguous range of hilbert keys
+struct shard
+{
+    Rtree *tree;  // only accessed by the worker thread while it has jobs
+    // hilbert keys in [keyLow, keyHigh) are routed to this shard, the last shard also owns HILBERT_LAST_KEY
+    unsigned long long keyLow;
+    unsigned long long keyHigh;
+    Rect mbr;   // MBR of all rectangles routed to this shard
+    int count;  // no of rectangles routed to this shard
+    pthread_t worker;
+    pthread_mutex_t lock;     // guards the job queue, its length and the done flags
+    pthread_cond_t hasJob;    // signalled when a job is queued
+    pthread_cond_t jobDone;   // signalled when a search or sync job is done
+    pthread_cond_t hasSpace;  // signalled when a job leaves a full queue
+    ShardJob *head;
+    ShardJob *tail;
+    int queued;  // no of jobs in the queue
+};
+
+// Space partitioned by hilbert key ranges into independent trees.
+// Calls are made from a single thread, the shards do the tree work in parallel.
+struct shardedIndex
+{
+    Shard shards[NUM_SHARDS];
+    int count;         // no of rectangles in the index
+    int rebalancedAt;  // no of rectangles at the last rebalance
+};
+
 /* -------------------------FUNCTION DEFINITIONS--------------------------- */
 NodeEle *createNodeEle(Node *container, Point topRight, Point bottomLeft);
 Node *createNode(NodeEle *parent, bool isLeaf);
 Rtree *createRtree();
 
 void traversal(Node *root, bool isInit);
+bool checkTree(Node *node);
+bool checkShardedIndex(bool skewed);
+int runChecks();
 
 int calculateAreaOfRectangle(Rect rec);
 Rect createMBR(Rect rect1, Rect rect2);
@@ -87,9 +172,41 @@ bool isPresent(NodeEle **e1, int s, NodeEle *e2);
 SplitResult *adjustTree(SplitResult *split);
 
 bool isOverlap(Rect r, Rect mbr);
+bool isContained(Rect inner, Rect outer);
+Rect padRect(Rect rect, int slack);
+Rect calcNodeMBR(Node *node);
+void enlargeUp(Node *node, Rect rect);
+void tightenUp(Node *node);
+void removeElement(Node *node, NodeEle *ele);
 void search(Node *searchNode, Rect searchRect);
-
-void insert(Rtree *r, Point p1, Point p2);
+void addResult(ResultList *results, Rect rect);
+void freeResultList(ResultList *results);
+void searchCollect(Node *searchNode, Rect searchRect, ResultList *results);
+
+void insertEntry(Rtree *r, NodeEle *entry);
+NodeEle *insert(Rtree *r, Point p1, Point p2);
+void reinsertNode(Rtree *r, Node *node);
+void condenseTree(Rtree *r, Node *leaf);
+void update(Rtree *r, NodeEle *entry, Point p1, Point p2);
+
+void freeNode(Node *node);
+void freeRtree(Rtree *r);
+
+unsigned long long hilbertKey(Rect rect);
+int compareKeyedRects(const void *a, const void *b);
+
+ShardJob *createJob(JobType type, Rect rect);
+void submitJob(Shard *shard, ShardJob *job);
+void waitJob(Shard *shard, ShardJob *job);
+void *shardWorker(void *arg);
+
+ShardedIndex *createShardedIndex();
+Shard *routeInsert(ShardedIndex *index, Rect rect);
+void shardedInsert(ShardedIndex *index, Point p1, Point p2);
+ResultList shardedSearch(ShardedIndex *index, Rect searchRect);
+void syncShards(ShardedIndex *index);
+void rebalanceShards(ShardedIndex *index);
+void destroyShardedIndex(ShardedIndex *index);
 /* --------------------------------------------GENERATING FUNCTIONS---------------------------------------------------
  */
 // create node element
@@ -118,9 +235,28 @@ Rtree *createRtree()
 {
     Rtree *rtree = (Rtree *)malloc(sizeof(Rtree));
     rtree->root = createNode(NULL, true);
+    rtree->slack = UPDATE_SLACK;
     return rtree;
 }
 
+// free a node along with its whole subtree
+void freeNode(Node *node)
+{
+    for (int i = 0; i < node->count; i++)
+    {
+        if (!node->isLeaf) freeNode(node->elements[i]->child);
+        free(node->elements[i]);
+    }
+    free(node->elements);
+    free(node);
+}
+// free tree along with all its nodes
+void freeRtree(Rtree *rtree)
+{
+    freeNode(rtree->root);
+    free(rtree);
+}
+
 /* ----------------------------------------------PREORDER TRAVERSAL----------------------------------------------------
  */
 // defining preorder - first, list all the current node elements -> then, traverse all the children in the same manner
@@ -278,6 +414,69 @@ bool isOverlap(Rect r, Rect mbr)
     return false;
 }
 
+// checks whether the inner rectangle lies completely within the outer one
+bool isContained(Rect inner, Rect outer)
+{
+    return inner.bottomLeft.x >= outer.bottomLeft.x && inner.bottomLeft.y >= outer.bottomLeft.y &&
+           inner.topRight.x <= outer.topRight.x && inner.topRight.y <= outer.topRight.y;
+}
+
+// grow a rectangle by slack on every side
+Rect padRect(Rect rect, int slack)
+{
+    rect.bottomLeft.x -= slack;
+    rect.bottomLeft.y -= slack;
+    rect.topRight.x += slack;
+    rect.topRight.y += slack;
+    return rect;
+}
+
+// MBR covering all the elements of a node
+Rect calcNodeMBR(Node *node)
+{
+    Rect mbr = node->elements[0]->mbr;
+    for (int i = 1; i < node->count; i++)
+    {
+        mbr = createMBR(mbr, node->elements[i]->mbr);
+    }
+    return mbr;
+}
+
+// grow the MBRs above node until one of them already covers rect
+void enlargeUp(Node *node, Rect rect)
+{
+    while (node->parent != NULL && !isContained(rect, node->parent->mbr))
+    {
+        node->parent->mbr = createMBR(node->parent->mbr, rect);
+        node = node->parent->container;
+    }
+}
+
+// recompute the MBRs above node after it lost an element, stopping once an MBR does not shrink
+void tightenUp(Node *node)
+{
+    while (node->parent != NULL)
+    {
+        Rect mbr = calcNodeMBR(node);
+        if (isContained(node->parent->mbr, mbr)) break;  // MBR unchanged -> ancestors unchanged too
+        node->parent->mbr = mbr;
+        node = node->parent->container;
+    }
+}
+
+// detach an element from a node without freeing it
+void removeElement(Node *node, NodeEle *ele)
+{
+    for (int i = 0; i < node->count; i++)
+    {
+        if (node->elements[i] == ele)
+        {
+            node->elements[i] = node->elements[--node->count];
+            break;
+        }
+    }
+}
+
 /*-------------------------INSERT CODE---------------------------------------------------- */
 
 /* CHOOSE LEAF */
@@ -517,8 +716,12 @@ SplitResult *nodeSplit(Node *node)
             pickNext(node, node1, node2);
         }
     }
+    // MBRs of the splits must also cover the elements alloted in the last iteration
+    createNodeParent(node1);
+    createNodeParent(node2);
 
     NodeEle *parent = node->parent;
+    free(node->elements);
     free(node);
 
     SplitResult *split = (SplitResult *)malloc(sizeof(SplitResult));
@@ -578,14 +781,13 @@ SplitResult *adjustTree(SplitResult *split)
 
 /* INSERT FUNCTION */
 
-// Insert function incorporating all other files
-void insert(Rtree *tree, Point bottomLeft, Point topRight)
+// Insert an already created leaf element into the tree
+void insertEntry(Rtree *tree, NodeEle *entry)
 {
-    Rect mbr = {topRight, bottomLeft};
     // choose leaf based on elem
-    Node *leaf = ChooseLeaf(tree, mbr);
-    leaf->elements[leaf->count++] =
-        createNodeEle(leaf, topRight, bottomLeft);  // create node_ele for element to be added
+    Node *leaf = ChooseLeaf(tree, entry->mbr);
+    leaf->elements[leaf->count++] = entry;
+    entry->container = leaf;
     SplitResult *split = NULL;
 
     if (leaf->count > MAX_ENTRIES)  // node overflowed -> node requires splitting
@@ -605,11 +807,133 @@ void insert(Rtree *tree, Point bottomLeft, Point topRight)
         Node *root = createNode(NULL, false);
         createNodeParent(split->leaf1);
         createNodeParent(split->leaf2);
-        NodeEle *dummy = createNodeEle(root, topRight, bottomLeft);
+        NodeEle *dummy = createNodeEle(root, entry->mbr.topRight, entry->mbr.bottomLeft);
         root->elements[root->count++] = dummy;
         updateParent(dummy, split->leaf1, split->leaf2);
         tree->root = root;
     }
+    free(split);
+
+    // MBRs on the whole path must cover the new element, splits may have refreshed only the lower ones
+    for (Node *node = entry->container; node->parent != NULL; node = node->parent->container)
+    {
+        node->parent->mbr = createMBR(node->parent->mbr, entry->mbr);
+    }
+}
+
+// Insert function incorporating all other files, returns the element as a handle for update
+NodeEle *insert(Rtree *tree, Point bottomLeft, Point topRight)
+{
+    NodeEle *entry = createNodeEle(NULL, topRight, bottomLeft);  // create node_ele for element to be added
+    insertEntry(tree, entry);
+    return entry;
+}
+
+/* -----------------------UPDATE FUNCTION------------------------------------------------- */
+
+// reinsert all the leaf elements below a detached node, freeing the node and its subtree
+void reinsertNode(Rtree *tree, Node *node)
+{
+    for (int i = 0; i < node->count; i++)
+    {
+        if (node->isLeaf)
+        {
+            insertEntry(tree, node->elements[i]);
+        }
+        else
+        {
+            reinsertNode(tree, node->elements[i]->child);
+            free(node->elements[i]);
+        }
+    }
+    free(node->elements);
+    free(node);
+}
+
+// CondenseTree from Guttman's paper: dissolve the underfull nodes on the path from leaf to the root,
+// tighten the MBRs of the remaining ones and reinsert the elements of the dissolved nodes
+void condenseTree(Rtree *tree, Node *leaf)
+{
+    int depth = 0;
+    for (Node *node = leaf; node->parent != NULL; node = node->parent->container) depth++;
+
+    // at most one node is dissolved per level
+    Node **orphans = (Node **)malloc(depth * sizeof(Node *));
+    int orphanCount = 0;
+    Node *node = leaf;
+
+    while (node->parent != NULL)  // Stop at root node
+    {
+        NodeEle *parent = node->parent;
+        Node *parentNode = parent->container;
+        if (node->count < MIN_ENTRIES)
+        {
+            removeElement(parentNode, parent);
+            free(parent);
+            node->parent = NULL;
+            orphans[orphanCount++] = node;
+        }
+        else
+        {
+            parent->mbr = calcNodeMBR(node);
+        }
+        node = parentNode;
+    }
+
+    // root left with a single child -> child becomes the root
+    while (!tree->root->isLeaf && tree->root->count == 1)
+    {
+        Node *root = tree->root;
+        tree->root = root->elements[0]->child;
+        tree->root->parent = NULL;
+        free(root->elements[0]);
+        free(root->elements);
+        free(root);
+    }
+    if (tree->root->count == 0) tree->root->isLeaf = true;
+
+    for (int i = 0; i < orphanCount; i++)
+    {
+        reinsertNode(tree, orphans[i]);
+    }
+    free(orphans);
+}
+
+// Move an inserted element to a new rectangle, working bottom-up from its leaf instead of the root
+void update(Rtree *tree, NodeEle *entry, Point bottomLeft, Point topRight)
+{
+    Rect mbr = {topRight, bottomLeft};
+    Node *leaf = entry->container;
+    entry->mbr = mbr;
+
+    // leaf is the root, there is no MBR above it to maintain
+    if (leaf->parent == NULL) return;
+
+    // new MBR still fits in the leaf MBR -> update stays local
+    if (isContained(mbr, leaf->parent->mbr)) return;
+
+    // tight MBR of the other elements of the leaf, so that a drifting element cannot stretch the leaf past the slack
+    Rect rest = leaf->elements[leaf->elements[0] == entry ? 1 : 0]->mbr;
+    for (int i = 0; i < leaf->count; i++)
+    {
+        if (leaf->elements[i] != entry) rest = createMBR(rest, leaf->elements[i]->mbr);
+    }
+
+    // small move within the slack -> recompute the leaf MBR and grow the MBRs above it bottom-up
+    if (isContained(mbr, padRect(rest, tree->slack)))
+    {
+        leaf->parent->mbr = calcNodeMBR(leaf);
+        enlargeUp(leaf->parent->container, mbr);
+        return;
+    }
+
+    // moved too far -> take the element out, fix the old path and reinsert it
+    removeElement(leaf, entry);
+    if (leaf->count < MIN_ENTRIES)
+        condenseTree(tree, leaf);  // leaf underflowed -> dissolve it and reinsert its elements
+    else
+        tightenUp(leaf);
+    insertEntry(tree, entry);
 }
 
 /* -----------------------SEARCH FUNCTION------------------------------------------------- */
@@ -640,10 +964,510 @@ void search(Node *searchNode, Rect searchRect)
     }
 }
 
+// append a rectangle to a result list, doubling its capacity when full
+void addResult(ResultList *results, Rect rect)
+{
+    if (results->count == results->capacity)
+    {
+        results->capacity = results->capacity == 0 ? 8 : 2 * results->capacity;
+        results->rects = (Rect *)realloc(results->rects, results->capacity * sizeof(Rect));
+    }
+    results->rects[results->count++] = rect;
+}
+
+// free the rectangles of a result list and leave it empty
+void freeResultList(ResultList *results)
+{
+    free(results->rects);
+    results->rects = NULL;
+    results->count = 0;
+    results->capacity = 0;
+}
+
+// same as search, but collects the overlapping leaf elements instead of printing them
+void searchCollect(Node *searchNode, Rect searchRect, ResultList *results)
+{
+    for (int i = 0; i < searchNode->count; i++)
+    {
+        if (isOverlap(searchRect, searchNode->elements[i]->mbr))
+        {
+            if (searchNode->isLeaf)
+                addResult(results, searchNode->elements[i]->mbr);
+            else
+                searchCollect(searchNode->elements[i]->child, searchRect, results);
+        }
+    }
+}
+
+/* -----------------------HILBERT KEY----------------------------------------------------- */
+
+// distance of the rectangle's center along the hilbert curve filling the whole int plane
+unsigned long long hilbertKey(Rect rect)
+{
+    long long centerX = (long long)rect.bottomLeft.x + ((long long)rect.topRight.x - rect.bottomLeft.x) / 2;
+    long long centerY = (long long)rect.bottomLeft.y + ((long long)rect.topRight.y - rect.bottomLeft.y) / 2;
+    // offset by INT_MIN so that every int coordinate maps onto the 2^32 x 2^32 grid
+    unsigned int x = centerX - INT_MIN;
+    unsigned int y = centerY - INT_MIN;
+    unsigned long long key = 0;
+
+    for (unsigned int s = 1u << (HILBERT_ORDER - 1); s > 0; s /= 2)
+    {
+        int rx = (x & s) > 0;
+        int ry = (y & s) > 0;
+        key += (unsigned long long)s * s * ((3 * rx) ^ ry);
+
+        // rotate the quadrant so that the curve stays continuous
+        if (ry == 0)
+        {
+            if (rx == 1)
+            {
+                x = UINT_MAX - x;
+                y = UINT_MAX - y;
+            }
+            unsigned int temp = x;
+            x = y;
+            y = temp;
+        }
+    }
+    return key;
+}
+
+// orders keyed rectangles by hilbert key for qsort
+int compareKeyedRects(const void *a, const void *b)
+{
+    unsigned long long keyA = ((const KeyedRect *)a)->key;
+    unsigned long long keyB = ((const KeyedRect *)b)->key;
+    return (keyA > keyB) - (keyA < keyB);
+}
+
+/* -----------------------SHARD WORKERS--------------------------------------------------- */
+
+// create a job for a shard worker
+ShardJob *createJob(JobType type, Rect rect)
+{
+    ShardJob *job = (ShardJob *)malloc(sizeof(ShardJob));
+    job->type = type;
+    job->rect = rect;
+    job->results.rects = NULL;
+    job->results.count = 0;
+    job->results.capacity = 0;
+    job->done = false;
+    job->next = NULL;
+    return job;
+}
+
+// append a job to the queue of a shard and wake up its worker,
+// blocking while the queue is full so that a fast caller cannot outrun the worker
+void submitJob(Shard *shard, ShardJob *job)
+{
+    pthread_mutex_lock(&shard->lock);
+    while (shard->queued >= SHARD_QUEUE_DEPTH) pthread_cond_wait(&shard->hasSpace, &shard->lock);
+    shard->queued++;
+    if (shard->tail == NULL)
+        shard->head = job;
+    else
+        shard->tail->next = job;
+    shard->tail = job;
+    pthread_cond_signal(&shard->hasJob);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+// block until the worker of a shard is done with a search or sync job
+void waitJob(Shard *shard, ShardJob *job)
+{
+    pthread_mutex_lock(&shard->lock);
+    while (!job->done) pthread_cond_wait(&shard->jobDone, &shard->lock);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+// worker thread owning the tree of a shard, runs the queued jobs in order
+void *shardWorker(void *arg)
+{
+    Shard *shard = (Shard *)arg;
+    while (true)
+    {
+        pthread_mutex_lock(&shard->lock);
+        while (shard->head == NULL) pthread_cond_wait(&shard->hasJob, &shard->lock);
+        ShardJob *job = shard->head;
+        shard->head = job->next;
+        if (shard->head == NULL) shard->tail = NULL;
+        if (shard->queued-- == SHARD_QUEUE_DEPTH) pthread_cond_signal(&shard->hasSpace);
+        pthread_mutex_unlock(&shard->lock);
+
+        if (job->type == JOB_STOP)
+        {
+            free(job);
+            return NULL;
+        }
+        if (job->type == JOB_INSERT)
+        {
+            insert(shard->tree, job->rect.bottomLeft, job->rect.topRight);
+            free(job);
+            continue;
+        }
+        if (job->type == JOB_SEARCH) searchCollect(shard->tree->root, job->rect, &job->results);
+
+        // search and sync jobs are freed by the thread waiting on them
+        pthread_mutex_lock(&shard->lock);
+        job->done = true;
+        pthread_cond_broadcast(&shard->jobDone);
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+/* -----------------------SHARDED INDEX--------------------------------------------------- */
+
+// create sharded index with the hilbert key space split evenly among the shards
+ShardedIndex *createShardedIndex()
+{
+    ShardedIndex *index = (ShardedIndex *)malloc(sizeof(ShardedIndex));
+    index->count = 0;
+    index->rebalancedAt = NUM_SHARDS * MAX_ENTRIES;  // not worth rebalancing a handful of rectangles
+
+    for (int i = 0; i < NUM_SHARDS; i++)
+    {
+        Shard *shard = &index->shards[i];
+        shard->tree = createRtree();
+        shard->keyLow = i * (HILBERT_LAST_KEY / NUM_SHARDS + 1);
+        shard->keyHigh = i == NUM_SHARDS - 1 ? HILBERT_LAST_KEY : (i + 1) * (HILBERT_LAST_KEY / NUM_SHARDS + 1);
+        shard->count = 0;
+        shard->head = NULL;
+        shard->tail = NULL;
+        shard->queued = 0;
+        pthread_mutex_init(&shard->lock, NULL);
+        pthread_cond_init(&shard->hasJob, NULL);
+        pthread_cond_init(&shard->jobDone, NULL);
+        pthread_cond_init(&shard->hasSpace, NULL);
+        pthread_create(&shard->worker, NULL, shardWorker, shard);
+    }
+    return index;
+}
+
+// queue an insert on the shard owning the rectangle's hilbert key
+Shard *routeInsert(ShardedIndex *index, Rect rect)
+{
+    unsigned long long key = hilbertKey(rect);
+    Shard *shard = NULL;
+    // key ranges cover [0, HILBERT_LAST_KEY] without gaps, so exactly one shard owns the key
+    for (int i = 0; shard == NULL; i++)
+    {
+        if (key >= index->shards[i].keyLow && (key < index->shards[i].keyHigh || i == NUM_SHARDS - 1))
+            shard = &index->shards[i];
+    }
+
+    // shard MBR is grown here, so queries queued after this insert already reach the shard
+    shard->mbr = shard->count == 0 ? rect : createMBR(shard->mbr, rect);
+    shard->count++;
+    index->count++;
+    submitJob(shard, createJob(JOB_INSERT, rect));
+    return shard;
+}
+
+// Insert function of the sharded index
+void shardedInsert(ShardedIndex *index, Point bottomLeft, Point topRight)
+{
+    Rect mbr = {topRight, bottomLeft};
+    Shard *shard = routeInsert(index, mbr);
+
+    // rebalance when a shard is skewed, at most once every time the index doubles in size
+    if (index->count >= 2 * index->rebalancedAt &&
+        100LL * shard->count * NUM_SHARDS > (long long)REBALANCE_PERCENT * index->count)
+    {
+        rebalanceShards(index);
+    }
+}
+
+// Search function of the sharded index, returns the merged leaf elements overlapping searchRect.
+// The caller owns the returned list and releases it with freeResultList.
+ResultList shardedSearch(ShardedIndex *index, Rect searchRect)
+{
+    ShardJob *jobs[NUM_SHARDS] = {NULL};
+    ResultList merged = {NULL, 0, 0};
+
+    // fan out only to the shards whose MBR overlaps the search MBR
+    for (int i = 0; i < NUM_SHARDS; i++)
+    {
+        Shard *shard = &index->shards[i];
+        if (shard->count > 0 && isOverlap(searchRect, shard->mbr))
+        {
+            jobs[i] = createJob(JOB_SEARCH, searchRect);
+            submitJob(shard, jobs[i]);
+        }
+    }
+
+    // merge results as the shards finish
+    for (int i = 0; i < NUM_SHARDS; i++)
+    {
+        if (jobs[i] == NULL) continue;
+        waitJob(&index->shards[i], jobs[i]);
+        for (int j = 0; j < jobs[i]->results.count; j++)
+        {
+            addResult(&merged, jobs[i]->results.rects[j]);
+        }
+        freeResultList(&jobs[i]->results);
+        free(jobs[i]);
+    }
+    return merged;
+}
+
+// wait until every shard is done with all the jobs queued so far
+void syncShards(ShardedIndex *index)
+{
+    ShardJob *jobs[NUM_SHARDS];
+    Rect empty = {{0, 0}, {0, 0}};
+    for (int i = 0; i < NUM_SHARDS; i++)
+    {
+        jobs[i] = createJob(JOB_SYNC, empty);
+        submitJob(&index->shards[i], jobs[i]);
+    }
+    for (int i = 0; i < NUM_SHARDS; i++)
+    {
+        waitJob(&index->shards[i], jobs[i]);
+        free(jobs[i]);
+    }
+}
+
+// redraw the key ranges so that every shard owns an equal share of the rectangles, then rebuild the shards
+void rebalanceShards(ShardedIndex *index)
+{
+    // workers are idle after syncing, so their trees can be read and replaced from here
+    syncShards(index);
+
+    KeyedRect *entries = (KeyedRect *)malloc(index->count * sizeof(KeyedRect));
+    int n = 0;
+    int largest = 0;  // no of rectangles in the largest shard before rebalancing
+    for (int i = 0; i < NUM_SHARDS; i++)
+    {
+        Shard *shard = &index->shards[i];
+        if (shard->count > 0)
+        {
+            // shard MBR covers every rectangle of the shard
+            ResultList all = {NULL, 0, 0};
+            searchCollect(shard->tree->root, shard->mbr, &all);
+            for (int j = 0; j < all.count; j++)
+            {
+                entries[n].key = hilbertKey(all.rects[j]);
+                entries[n++].rect = all.rects[j];
+            }
+            freeResultList(&all);
+        }
+        largest = fmax(largest, shard->count);
+    }
+    qsort(entries, n, sizeof(KeyedRect), compareKeyedRects);
+
+    // shard i starts at the key of the (i * n / NUM_SHARDS)th rectangle. Rectangles sharing a key must stay
+    // in one shard, so many equal keys make several cuts coincide and leave the shards between them empty.
+    unsigned long long cuts[NUM_SHARDS + 1];
+    cuts[0] = 0;
+    cuts[NUM_SHARDS] = HILBERT_LAST_KEY;
+    for (int i = 1; i < NUM_SHARDS; i++)
+    {
+        cuts[i] = entries[i * n / NUM_SHARDS].key;
+    }
+
+    // largest shard the new cuts would give, entries are sorted so each shard is a contiguous run
+    int newLargest = 0;
+    for (int i = 0, j = 0; i < NUM_SHARDS; i++)
+    {
+        int start = j;
+        while (j < n && (entries[j].key < cuts[i + 1] || i == NUM_SHARDS - 1)) j++;
+        newLargest = fmax(newLargest, j - start);
+    }
+
+    // skip the rebuild when the cuts would not shrink the largest shard, e.g. when most keys are equal
+    if (newLargest >= largest)
+    {
+        index->rebalancedAt = index->count;
+        free(entries);
+        return;
+    }
+
+    for (int i = 0; i < NUM_SHARDS; i++)
+    {
+        Shard *shard = &index->shards[i];
+        shard->keyLow = cuts[i];
+        shard->keyHigh = cuts[i + 1];
+        freeRtree(shard->tree);
+        shard->tree = createRtree();
+        shard->count = 0;
+    }
+
+    // rebuild the shards in parallel
+    index->count = 0;
+    for (int i = 0; i < n; i++)
+    {
+        routeInsert(index, entries[i].rect);
+    }
+    index->rebalancedAt = index->count;
+    free(entries);
+}
+
+// stop the workers and free the sharded index along with all its trees
+void destroyShardedIndex(ShardedIndex *index)
+{
+    Rect empty = {{0, 0}, {0, 0}};
+    for (int i = 0; i < NUM_SHARDS; i++)
+    {
+        submitJob(&index->shards[i], createJob(JOB_STOP, empty));
+    }
+    for (int i = 0; i < NUM_SHARDS; i++)
+    {
+        Shard *shard = &index->shards[i];
+        pthread_join(shard->worker, NULL);
+        freeRtree(shard->tree);
+        pthread_mutex_destroy(&shard->lock);
+        pthread_cond_destroy(&shard->hasJob);
+        pthread_cond_destroy(&shard->jobDone);
+        pthread_cond_destroy(&shard->hasSpace);
+    }
+    free(index);
+}
+
+/* ------------------------INVARIANT CHECKS---------------------------------------------- */
+
+// verify that every element points to its container, non-root nodes are not underfull
+// and every parent MBR covers all the elements of its child node
+bool checkTree(Node *node)
+{
+    for (int i = 0; i < node->count; i++)
+    {
+        NodeEle *ele = node->elements[i];
+        if (ele->container != node) return false;
+        if (node->isLeaf) continue;
+
+        Node *child = ele->child;
+        if (child->parent != ele || child->count < MIN_ENTRIES) return false;
+        if (!isContained(calcNodeMBR(child), ele->mbr)) return false;
+        if (!checkTree(child)) return false;
+    }
+    return true;
+}
+
+// insert random points into a sharded index, comparing searches against brute force along the way, then check
+// every shard's tree. Skewed points are mostly packed into one small square so that the shards get rebalanced.
+bool checkShardedIndex(bool skewed)
+{
+    Rect *points = (Rect *)malloc(CHECK_SHARDED_POINTS * sizeof(Rect));
+    ShardedIndex *index = createShardedIndex();
+    unsigned long long firstCut = index->shards[1].keyLow;
+    bool valid = true;
+
+    for (int i = 0; i < CHECK_SHARDED_POINTS; i++)
+    {
+        Point p = {rand() % 40000 - 20000, rand() % 40000 - 20000};
+        if (skewed && i % 10 != 0)
+        {
+            p.x = 100 + rand() % 300;
+            p.y = 100 + rand() % 300;
+        }
+        points[i].bottomLeft = p;
+        points[i].topRight = p;
+        shardedInsert(index, p, p);
+
+        if ((i + 1) % CHECK_SEARCH_EVERY == 0)
+        {
+            // searches on skewed points look inside the packed square
+            int range = skewed ? 400 : 40000;
+            int offset = skewed ? 0 : 20000;
+            Point corner = {rand() % range - offset, rand() % range - offset};
+            Rect searchRect = {{corner.x + rand() % 2000, corner.y + rand() % 2000}, corner};
+            int expected = 0;
+            for (int j = 0; j <= i; j++)
+            {
+                if (isOverlap(searchRect, points[j])) expected++;
+            }
+            ResultList results = shardedSearch(index, searchRect);
+            if (results.count != expected) valid = false;
+            freeResultList(&results);
+        }
+    }
+
+    // the trees can be read from here once the workers are idle
+    syncShards(index);
+    int total = 0;
+    for (int i = 0; i < NUM_SHARDS; i++)
+    {
+        if (!checkTree(index->shards[i].tree->root)) valid = false;
+        total += index->shards[i].count;
+    }
+    if (total != CHECK_SHARDED_POINTS) valid = false;
+
+    // skewed points start out in a single shard, so the key ranges must have been redrawn
+    bool rebalanced = index->shards[1].keyLow != firstCut;
+    if (skewed && !rebalanced) valid = false;
+    printf("Sharded index (%s): %s%s\n", skewed ? "skewed" : "uniform", valid ? "searches match" : "INVALID",
+           rebalanced ? ", shards rebalanced" : "");
+
+    destroyShardedIndex(index);
+    free(points);
+    return valid;
+}
+
+// insert random points, move them around with update and check the tree after both steps,
+// then check the sharded index on uniform and skewed points
+int runChecks()
+{
+    NodeEle **entries = (NodeEle **)malloc(CHECK_POINTS * sizeof(NodeEle *));
+    Rect everything = {{2000, 2000}, {-1000, -1000}};  // covers every point even after the small moves
+    Rtree *tree = createRtree();
+    tree->slack = 2;
+    srand(36);
+
+    for (int i = 0; i < CHECK_POINTS; i++)
+    {
+        Point p = {rand() % 1000, rand() % 1000};
+        entries[i] = insert(tree, p, p);
+    }
+    bool inserted = checkTree(tree->root);
+    printf("Insert: %s\n", inserted ? "tree is valid" : "tree is INVALID");
+
+    // alternate small moves with moves to anywhere
+    for (int k = 0; k < CHECK_MOVES; k++)
+    {
+        NodeEle *entry = entries[rand() % CHECK_POINTS];
+        Point p = entry->mbr.bottomLeft;
+        if (k % 2 == 0)
+        {
+            p.x += rand() % 5 - 2;
+            p.y += rand() % 5 - 2;
+        }
+        else
+        {
+            p.x = rand() % 1000;
+            p.y = rand() % 1000;
+        }
+        update(tree, entry, p, p);
+    }
+
+    // every handle must still be an element of its leaf and be found by a search
+    bool updated = checkTree(tree->root);
+    for (int i = 0; i < CHECK_POINTS; i++)
+    {
+        Node *leaf = entries[i]->container;
+        if (!leaf->isLeaf || !isPresent(leaf->elements, leaf->count, entries[i])) updated = false;
+    }
+    ResultList found = {NULL, 0, 0};
+    searchCollect(tree->root, everything, &found);
+    if (found.count != CHECK_POINTS) updated = false;
+    printf("Update: %s\n", updated ? "tree is valid" : "tree is INVALID");
+
+    freeResultList(&found);
+    free(entries);
+    freeRtree(tree);
+
+    bool uniform = checkShardedIndex(false);
+    bool skewed = checkShardedIndex(true);
+    return inserted && updated && uniform && skewed ? 0 : 1;
+}
+
 /* ------------------------MAIN FUNCTION-------------------------------------------------- */
 
-int main()
+int main(int argc, char *argv[])
 {
+    // `./exec check` verifies the tree on random points instead of reading data.txt
+    if (argc > 1 && strcmp(argv[1], "check") == 0) return runChecks();
+
     FILE *fp = fopen("data.txt", "r");
 
     // Print error message if file opening fails
@@ -677,5 +1501,18 @@ int main()
     //  searchRect.topRight.y = 20;
     //  search(tree->root, searchRect);
 
+    // Elements can be moved using the handle returned by insert
+    //  NodeEle *entry = insert(tree, bottomLeft, topRight);
+    //  tree->slack = 2;
+    //  Point moved = {x + 1, y};
+    //  update(tree, entry, moved, moved);
+
+    // The sharded index spreads the points over NUM_SHARDS trees searched in parallel
+    //  ShardedIndex *index = createShardedIndex();
+    //  shardedInsert(index, bottomLeft, topRight);
+    //  ResultList results = shardedSearch(index, searchRect);
+    //  freeResultList(&results);
+    //  destroyShardedIndex(index);
+
     return 0;
 }